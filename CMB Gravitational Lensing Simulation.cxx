@@ -4,6 +4,23 @@
 #include <iomanip>
 #include <random>
 #include <string>
+#include <complex>
+#include <memory>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 using namespace std;
 
@@ -16,128 +33,1290 @@ using namespace std;
 ==========================================================
 */
 
-constexpr int N = 64;          // Angular resolution
+constexpr int MAX_N = 16384;   // Largest supported angular resolution
 constexpr double PI = 3.141592653589793;
 constexpr double G = 1.0;      // Scaled gravitational constant
 
-// 2D Grid Type
-using Grid = vector<vector<double>>;
+using cplx = complex<double>;
 
-// Generate Gaussian random field (Primary CMB)
-Grid generatePrimaryCMB() {
-    Grid cmb(N, vector<double>(N));
-    default_random_engine gen;
-    normal_distribution<double> dist(0.0, 1.0);
+// Square N x N map in one contiguous 64-byte aligned block, row-major.
+// Rows are padded to a multiple of 8 doubles so every row starts on a cache line.
+// The block is normally owned (aligned_alloc), but a map can also adopt
+// external storage such as a memory-mapped file, released by its own deleter.
+struct Map2D {
+    int n = 0;
+    size_t stride = 0;
+    unique_ptr<double[], function<void(double*)>> buf{nullptr, [](double* p) { free(p); }};
 
-    for (int i = 0; i < N; i++)
-        for (int j = 0; j < N; j++)
-            cmb[i][j] = dist(gen);
+    Map2D() = default;
+    explicit Map2D(int size) { resize(size); }
 
-    return cmb;
+    void resize(int size) {
+        n = size;
+        stride = (size_t(size) + 7) & ~size_t(7);
+        size_t bytes = stride * size_t(size) * sizeof(double);
+        double* data = static_cast<double*>(aligned_alloc(64, bytes));
+        if (!data) throw bad_alloc();
+        buf = unique_ptr<double[], function<void(double*)>>(data, [](double* p) { free(p); });
+        fill(buf.get(), buf.get() + stride * size_t(size), 0.0);
+    }
+
+    // Use rowStride-spaced rows at data; release(data) runs when the map drops them
+    void adopt(int size, size_t rowStride, double* data, function<void(double*)> release) {
+        n = size;
+        stride = rowStride;
+        buf = unique_ptr<double[], function<void(double*)>>(data, move(release));
+    }
+
+    double* row(int i) { return buf.get() + size_t(i) * stride; }
+    const double* row(int i) const { return buf.get() + size_t(i) * stride; }
+    double& operator()(int i, int j) { return row(i)[j]; }
+    double operator()(int i, int j) const { return row(i)[j]; }
+};
+
+// Threads used by parallelRows on the calling thread (0 = all hardware threads).
+// Batch workers set 1 because they already run one realization per core.
+thread_local int rowThreads = 0;
+
+// Split rows [0, n) into contiguous blocks and run body(begin, end) on each
+// block in its own thread
+template <class Body>
+void parallelRows(int n, Body body) {
+    int hw = rowThreads > 0 ? rowThreads : int(thread::hardware_concurrency());
+    int threads = max(1, min(n, hw));
+    if (threads == 1) {
+        body(0, n);
+        return;
+    }
+    int chunk = (n + threads - 1) / threads;
+    vector<thread> pool;
+    for (int begin = 0; begin < n; begin += chunk)
+        pool.emplace_back(body, begin, min(n, begin + chunk));
+    for (thread& t : pool) t.join();
+}
+
+// Radix-2 FFT plan: bit-reversal permutation and twiddle factors for length n
+struct FFTPlan {
+    int n;
+    vector<int> rev;
+    vector<cplx> twiddle;   // exp(-2 pi i k / n), k < n/2
+
+    explicit FFTPlan(int size) : n(size), rev(size), twiddle(size / 2) {
+        int bits = 0;
+        while ((1 << bits) < n) bits++;
+        for (int i = 0; i < n; i++) {
+            rev[i] = 0;
+            for (int b = 0; b < bits; b++)
+                if (i & (1 << b)) rev[i] |= 1 << (bits - 1 - b);
+        }
+        for (int k = 0; k < n / 2; k++)
+            twiddle[k] = polar(1.0, -2.0 * PI * k / n);
+    }
+
+    // In-place unnormalized transform; inverse uses exp(+2 pi i k / n)
+    void transform(cplx* a, bool inverse) const {
+        for (int i = 0; i < n; i++)
+            if (i < rev[i]) swap(a[i], a[rev[i]]);
+        for (int len = 2; len <= n; len <<= 1) {
+            int step = n / len;
+            for (int i = 0; i < n; i += len) {
+                for (int k = 0; k < len / 2; k++) {
+                    cplx w = inverse ? conj(twiddle[k * step]) : twiddle[k * step];
+                    cplx u = a[i + k];
+                    cplx v = a[i + k + len / 2] * w;
+                    a[i + k] = u + v;
+                    a[i + k + len / 2] = u - v;
+                }
+            }
+        }
+    }
+};
+
+// Half-plane spectrum of a real N x N map: rows are kx = 0..N-1, columns ky = 0..N/2
+struct Spectrum {
+    int n, nh;
+    vector<cplx> data;
+    explicit Spectrum(int size) : n(size), nh(size / 2 + 1), data(size_t(size) * (size / 2 + 1)) {}
+    cplx& at(int i, int j) { return data[size_t(i) * nh + j]; }
+};
+
+// FFT plan and scratch buffers for one N x N pipeline, allocated once and
+// reused by every stage and every realization run on the same thread
+struct Workspace {
+    FFTPlan plan;
+    Spectrum specA, specB;
+    Map2D scratch;
+    explicit Workspace(int size) : plan(size), specA(size), specB(size), scratch(size) {}
+};
+
+// Angular wavenumber (radians per pixel) of FFT index m
+inline double waveNumber(int m, int n) {
+    return 2.0 * PI * (m <= n / 2 ? m : m - n) / n;
+}
+
+// Real-to-complex 2D FFT. Two real rows are transformed at once as the real and
+// imaginary parts of one complex row, then the N/2+1 half-spectrum columns.
+void forwardFFT2D(const FFTPlan& plan, const Map2D& in, Spectrum& out) {
+    int n = plan.n, nh = out.nh;
+    parallelRows(n / 2, [&](int pairBegin, int pairEnd) {
+        vector<cplx> z(n);
+        for (int i = 2 * pairBegin; i < 2 * pairEnd; i += 2) {
+            const double* r0 = in.row(i);
+            const double* r1 = in.row(i + 1);
+            for (int j = 0; j < n; j++) z[j] = cplx(r0[j], r1[j]);
+            plan.transform(z.data(), false);
+            for (int k = 0; k < nh; k++) {
+                cplx zk = z[k], zm = conj(z[(n - k) % n]);
+                out.at(i, k) = 0.5 * (zk + zm);
+                out.at(i + 1, k) = cplx(0.0, -0.5) * (zk - zm);
+            }
+        }
+    });
+    parallelRows(nh, [&](int colBegin, int colEnd) {
+        vector<cplx> z(n);
+        for (int k = colBegin; k < colEnd; k++) {
+            for (int i = 0; i < n; i++) z[i] = out.at(i, k);
+            plan.transform(z.data(), false);
+            for (int i = 0; i < n; i++) out.at(i, k) = z[i];
+        }
+    });
+}
+
+// Complex-to-real inverse 2D FFT (normalized by 1/N^2); the spectrum is consumed
+void inverseFFT2D(const FFTPlan& plan, Spectrum& in, Map2D& out) {
+    int n = plan.n, nh = in.nh;
+    parallelRows(nh, [&](int colBegin, int colEnd) {
+        vector<cplx> z(n);
+        for (int k = colBegin; k < colEnd; k++) {
+            for (int i = 0; i < n; i++) z[i] = in.at(i, k);
+            plan.transform(z.data(), true);
+            for (int i = 0; i < n; i++) in.at(i, k) = z[i];
+        }
+    });
+    double norm = 1.0 / (double(n) * n);
+    parallelRows(n / 2, [&](int pairBegin, int pairEnd) {
+        vector<cplx> z(n);
+        for (int i = 2 * pairBegin; i < 2 * pairEnd; i += 2) {
+            // Rebuild the full rows from Hermitian symmetry and pack rows i, i+1 as re/im
+            for (int k = 0; k < nh; k++) z[k] = in.at(i, k) + cplx(0.0, 1.0) * in.at(i + 1, k);
+            for (int k = nh; k < n; k++)
+                z[k] = conj(in.at(i, n - k)) + cplx(0.0, 1.0) * conj(in.at(i + 1, n - k));
+            plan.transform(z.data(), true);
+            double* r0 = out.row(i);
+            double* r1 = out.row(i + 1);
+            for (int j = 0; j < n; j++) {
+                r0[j] = z[j].real() * norm;
+                r1[j] = z[j].imag() * norm;
+            }
+        }
+    });
+}
+
+// Temperature power spectrum C_ℓ (μK²) sampled at increasing ℓ, linearly interpolated
+struct ClTable {
+    vector<double> ell, cl;
+
+    double operator()(double l) const {
+        if (ell.empty() || l < ell.front() || l > ell.back()) return 0.0;
+        size_t hi = upper_bound(ell.begin(), ell.end(), l) - ell.begin();
+        if (hi == ell.size()) return cl.back();
+        size_t lo = hi - 1;
+        double t = (l - ell[lo]) / (ell[hi] - ell[lo]);
+        return cl[lo] + t * (cl[hi] - cl[lo]);
+    }
+};
+
+// Toy ΛCDM-like TT spectrum: Sachs-Wolfe plateau, three acoustic peaks and
+// Silk damping, given as D_ℓ = ℓ(ℓ+1)C_ℓ/2π in μK²
+ClTable defaultClTable(int lmax = 20000) {
+    ClTable t;
+    for (int l = 2; l <= lmax; l++) {
+        double Dl = 1000.0 * l / (l + 60.0)
+                  + 4800.0 * exp(-pow((l - 220.0) / 110.0, 2))
+                  + 1900.0 * exp(-pow((l - 540.0) / 110.0, 2))
+                  + 2000.0 * exp(-pow((l - 810.0) / 120.0, 2));
+        Dl *= exp(-pow(l / 1500.0, 2));
+        t.ell.push_back(l);
+        t.cl.push_back(Dl * 2.0 * PI / (l * (l + 1.0)));
+    }
+    return t;
+}
+
+// Read "ell D_ell" columns (CAMB-style, μK², extra columns ignored, '#' comments)
+bool loadClTable(const string& path, ClTable& t) {
+    ifstream in(path);
+    if (!in) return false;
+    t.ell.clear();
+    t.cl.clear();
+    string line;
+    while (getline(in, line)) {
+        if (line.empty() || line[0] == '#') continue;
+        istringstream ss(line);
+        double l, Dl;
+        if (!(ss >> l >> Dl) || l < 1) continue;
+        if (!t.ell.empty() && l <= t.ell.back()) continue;
+        t.ell.push_back(l);
+        t.cl.push_back(Dl * 2.0 * PI / (l * (l + 1.0)));
+    }
+    return t.ell.size() >= 2;
+}
+
+// Counter-based RNG: splitmix64 finalizer applied to key + counter * golden
+// gamma. Every value depends only on (seed, counter), so any pixel can be
+// drawn on any thread and the map is identical for every thread count.
+inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+inline double uniformOpen(uint64_t key, uint64_t counter) {
+    uint64_t bits = mix64(key + (counter + 1) * 0x9E3779B97F4A7C15ULL);
+    return ((bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);   // (0, 1)
+}
+
+// Gaussian random field with power spectrum C_ℓ on a square patch of side
+// fieldRad radians. Unit white noise (Box-Muller pairs from the counter RNG)
+// is transformed, each mode is scaled by sqrt(C_ℓ)/Δ with Δ the pixel size
+// and ℓ = |k|/Δ, and the result is transformed back.
+void generateGaussianField(Map2D& cmb, const ClTable& cl, double fieldRad, uint64_t seed, Workspace& ws) {
+    int n = cmb.n;
+    uint64_t key = mix64(seed);
+
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; i++) {
+            double* r = cmb.row(i);
+            for (int j = 0; j < n; j += 2) {
+                uint64_t pair = (uint64_t(i) * n + j) / 2;
+                double u1 = uniformOpen(key, 2 * pair);
+                double u2 = uniformOpen(key, 2 * pair + 1);
+                double rad = sqrt(-2.0 * log(u1));
+                r[j] = rad * cos(2.0 * PI * u2);
+                r[j + 1] = rad * sin(2.0 * PI * u2);
+            }
+        }
+    });
+
+    Spectrum& modes = ws.specA;
+    forwardFFT2D(ws.plan, cmb, modes);
+    double pixel = fieldRad / n;
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; i++) {
+            double kx = waveNumber(i, n);
+            for (int j = 0; j < modes.nh; j++) {
+                double ky = waveNumber(j, n);
+                double ell = sqrt(kx * kx + ky * ky) / pixel;
+                modes.at(i, j) *= sqrt(cl(ell)) / pixel;
+            }
+        }
+    });
+    inverseFFT2D(ws.plan, modes, cmb);
+}
+
+// Primary CMB temperature map (μK) for one realization seed
+void generatePrimaryCMB(Map2D& cmb, const ClTable& cl, double fieldRad, uint64_t seed, Workspace& ws) {
+    generateGaussianField(cmb, cl, fieldRad, seed, ws);
 }
 
 // Simulated Large-Scale Structure Mass Distribution
-Grid generateMassDistribution() {
-    Grid rho(N, vector<double>(N));
+void generateMassDistribution(Map2D& rho) {
+    int n = rho.n;
+    for (int i = 0; i < n; i++) {
+        double* r = rho.row(i);
+        double x = (i - n / 2.0) / n;
+        for (int j = 0; j < n; j++) {
+            double y = (j - n / 2.0) / n;
+            r[j] = exp(-(x * x + y * y) * 20.0);
+        }
+    }
+}
+
+// Solve the lensing Poisson equation ∇²φ = 2κ in Fourier space (periodic map,
+// κ = G ρ in scaled units): φ_k = -2 κ_k / k², and α = ∇φ from α_k = i k φ_k.
+// One real-to-complex FFT of ρ; each output field is inverted from a scratch
+// copy of φ_k so only two half-plane spectra are alive at once.
+void computeLensingFields(
+    const Map2D& rho,
+    Map2D& phi,
+    Map2D& alphaX,
+    Map2D& alphaY,
+    Workspace& ws
+) {
+    int n = rho.n;
+    const FFTPlan& plan = ws.plan;
+    Spectrum& phiK = ws.specA;
+    Spectrum& scratch = ws.specB;
+    forwardFFT2D(plan, rho, phiK);
+    for (int i = 0; i < n; i++) {
+        double kx = waveNumber(i, n);
+        for (int j = 0; j < phiK.nh; j++) {
+            double ky = waveNumber(j, n);
+            double k2 = kx * kx + ky * ky;
+            phiK.at(i, j) = (k2 > 0) ? -2.0 * G * phiK.at(i, j) / k2 : 0.0;
+        }
+    }
 
-    for (int i = 0; i < N; i++) {
-        for (int j = 0; j < N; j++) {
-            double x = (i - N / 2.0) / N;
-            double y = (j - N / 2.0) / N;
-            rho[i][j] = exp(-(x * x + y * y) * 20.0);
+    // Gradient; the Nyquist row/column has no well-defined sign and is dropped
+    for (int axis = 0; axis < 2; axis++) {
+        for (int i = 0; i < n; i++) {
+            double kx = (i == n / 2) ? 0.0 : waveNumber(i, n);
+            for (int j = 0; j < phiK.nh; j++) {
+                double ky = (j == n / 2) ? 0.0 : waveNumber(j, n);
+                scratch.at(i, j) = cplx(0.0, axis == 0 ? kx : ky) * phiK.at(i, j);
+            }
         }
+        inverseFFT2D(plan, scratch, axis == 0 ? alphaX : alphaY);
+    }
+    inverseFFT2D(plan, phiK, phi);
+}
+
+// Toy convergence spectrum C^κ_ℓ of the full line of sight to the CMB
+ClTable defaultConvergenceTable(int lmax = 20000) {
+    ClTable t;
+    for (int l = 2; l <= lmax; l++) {
+        t.ell.push_back(l);
+        t.cl.push_back(1.0e-7 / (1.0 + pow(l / 200.0, 2.0)));
+    }
+    return t;
+}
+
+// Multi-plane ray tracing from the observer to the CMB through `planes`
+// Gaussian convergence planes at comoving distances D_k = (k + 1/2)/P (CMB
+// at D_s = 1). Plane k carries the share w_k² / Σw² of C^κ, with lensing
+// efficiency w_k = D_k (D_s - D_k), so the Born total has spectrum C^κ. Its
+// potential ψ_k (∇²ψ_k = 2κ_k, pixel units) and deflection come from the FFT
+// solver. Rays start on the pixel grid and follow the two-step recursion
+//   d_{k+1} = (1 - c_k) d_{k-1} + c_k d_k + s_k ∇ψ_k(x + d_k),
+//   c_k = D_k D_{k-1,k+1} / (D_{k+1} D_{k-1,k}),  s_k = D_{k,k+1} D_s / (D_{k+1} D_{k,s}),
+// with d the ray displacement from its grid pixel. Only two displacement
+// arrays and one plane are held at a time. The final displacement is
+// returned in alphaX/alphaY for lensCMB, and phiBorn = Σ ψ_k is the
+// single-plane potential to compare reconstructions against.
+void traceMultiPlane(
+    int planes,
+    const ClTable& kappaCl,
+    double fieldRad,
+    uint64_t seed,
+    Map2D& phiBorn,
+    Map2D& alphaX,
+    Map2D& alphaY,
+    Workspace& ws
+) {
+    int n = alphaX.n;
+    int mask = n - 1;
+    vector<double> dist(planes + 1);
+    double wSum = 0.0;
+    for (int k = 0; k < planes; k++) {
+        dist[k] = (k + 0.5) / planes;
+        wSum += pow(dist[k] * (1.0 - dist[k]), 2);
+    }
+    dist[planes] = 1.0;
+
+    Map2D prevX(n), prevY(n), kappa(n), psi(n), gradX(n), gradY(n);
+    for (Map2D* m : {&prevX, &prevY, &alphaX, &alphaY, &phiBorn})
+        fill(m->row(0), m->row(0) + m->stride * n, 0.0);
+
+    ClTable planeCl = kappaCl;
+    for (int k = 0; k < planes; k++) {
+        double share = pow(dist[k] * (1.0 - dist[k]), 2) / wSum;
+        for (size_t m = 0; m < kappaCl.cl.size(); m++) planeCl.cl[m] = kappaCl.cl[m] * share;
+        generateGaussianField(kappa, planeCl, fieldRad, mix64(seed) + 0x9E3779B97F4A7C15ULL * (k + 1), ws);
+        computeLensingFields(kappa, psi, gradX, gradY, ws);
+
+        double dPrev = (k == 0) ? 0.0 : dist[k - 1];
+        double c = dist[k] * (dist[k + 1] - dPrev) / (dist[k + 1] * (dist[k] - dPrev));
+        double step = (dist[k + 1] - dist[k]) / (dist[k + 1] * (1.0 - dist[k]));
+
+        parallelRows(n, [&](int rowBegin, int rowEnd) {
+            for (int i = rowBegin; i < rowEnd; i++) {
+                double* px = prevX.row(i);
+                double* py = prevY.row(i);
+                double* cx = alphaX.row(i);
+                double* cy = alphaY.row(i);
+                double* phiRow = phiBorn.row(i);
+                const double* psiRow = psi.row(i);
+                for (int j = 0; j < n; j++) {
+                    // Bilinear, periodic lookup of ∇ψ_k at the ray position on plane k
+                    double x = i + cx[j], y = j + cy[j];
+                    double xf = floor(x), yf = floor(y);
+                    double tx = x - xf, ty = y - yf;
+                    int x0 = int(xf) & mask, x1 = (x0 + 1) & mask;
+                    int y0 = int(yf) & mask, y1 = (y0 + 1) & mask;
+                    auto bilinear = [&](const Map2D& f) {
+                        double top = f(x0, y0) + ty * (f(x0, y1) - f(x0, y0));
+                        double bottom = f(x1, y0) + ty * (f(x1, y1) - f(x1, y0));
+                        return top + tx * (bottom - top);
+                    };
+                    double ax = bilinear(gradX), ay = bilinear(gradY);
+
+                    double nx = (1.0 - c) * px[j] + c * cx[j] + step * ax;
+                    double ny = (1.0 - c) * py[j] + c * cy[j] + step * ay;
+                    px[j] = cx[j];
+                    py[j] = cy[j];
+                    cx[j] = nx;
+                    cy[j] = ny;
+                    phiRow[j] += psiRow[j];
+                }
+            }
+        });
     }
-    return rho;
 }
 
-// Compute Lensing Potential φ from mass distribution
-Grid computeLensingPotential(const Grid& rho) {
-    Grid phi(N, vector<double>(N, 0.0));
+enum class Interp { Bilinear, Bicubic };
+
+// Lensing remap T_lensed(x) = T(x + α(x)) on the periodic map. Each row is
+// done in two passes: a coordinate pass (floor, fractional part, wrapped
+// source index) with no gathers, then a gather pass whose per-column
+// arithmetic is independent, so both inner loops vectorize. Rows are split
+// across threads.
+void lensCMB(
+    const Map2D& cmb,
+    const Map2D& alphaX,
+    const Map2D& alphaY,
+    Map2D& lensed,
+    Interp method
+) {
+    int n = cmb.n;
+    int mask = n - 1;   // n is a power of two: & mask is the periodic wrap
+
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        vector<double> fx(n), fy(n);
+        vector<int> x0(n), y0(n);
+
+        for (int i = rowBegin; i < rowEnd; i++) {
+            const double* ax = alphaX.row(i);
+            const double* ay = alphaY.row(i);
+            double* out = lensed.row(i);
+
+            for (int j = 0; j < n; j++) {
+                double x = i + ax[j];
+                double y = j + ay[j];
+                double xf = floor(x), yf = floor(y);
+                fx[j] = x - xf;
+                fy[j] = y - yf;
+                x0[j] = int(xf) & mask;
+                y0[j] = int(yf) & mask;
+            }
 
-    for (int i = 1; i < N - 1; i++) {
-        for (int j = 1; j < N - 1; j++) {
-            phi[i][j] =
-                G * (
-                    rho[i + 1][j] +
-                    rho[i - 1][j] +
-                    rho[i][j + 1] +
-                    rho[i][j - 1] -
-                    4.0 * rho[i][j]
-                );
+            if (method == Interp::Bilinear) {
+                for (int j = 0; j < n; j++) {
+                    const double* r0 = cmb.row(x0[j]);
+                    const double* r1 = cmb.row((x0[j] + 1) & mask);
+                    int c0 = y0[j], c1 = (y0[j] + 1) & mask;
+                    double tx = fx[j], ty = fy[j];
+                    double top = r0[c0] + ty * (r0[c1] - r0[c0]);
+                    double bottom = r1[c0] + ty * (r1[c1] - r1[c0]);
+                    out[j] = top + tx * (bottom - top);
+                }
+            } else {
+                // Catmull-Rom (Keys, a = -1/2) kernel over the 4 x 4 neighbourhood
+                for (int j = 0; j < n; j++) {
+                    double tx = fx[j], ty = fy[j];
+                    double wx[4] = {
+                        tx * (-0.5 + tx * (1.0 - 0.5 * tx)),
+                        1.0 + tx * tx * (-2.5 + 1.5 * tx),
+                        tx * (0.5 + tx * (2.0 - 1.5 * tx)),
+                        tx * tx * (-0.5 + 0.5 * tx)
+                    };
+                    double wy[4] = {
+                        ty * (-0.5 + ty * (1.0 - 0.5 * ty)),
+                        1.0 + ty * ty * (-2.5 + 1.5 * ty),
+                        ty * (0.5 + ty * (2.0 - 1.5 * ty)),
+                        ty * ty * (-0.5 + 0.5 * ty)
+                    };
+                    int c[4];
+                    for (int b = 0; b < 4; b++) c[b] = (y0[j] - 1 + b) & mask;
+                    double sum = 0.0;
+                    for (int a = 0; a < 4; a++) {
+                        const double* r = cmb.row((x0[j] - 1 + a) & mask);
+                        sum += wx[a] * (wy[0] * r[c[0]] + wy[1] * r[c[1]] +
+                                        wy[2] * r[c[2]] + wy[3] * r[c[3]]);
+                    }
+                    out[j] = sum;
+                }
+            }
         }
+    });
+}
+
+// Binned flat-sky power spectrum: bin b covers [b, b+1) * width in ℓ
+struct BandPowers {
+    double width = 0.0;
+    vector<double> ellSum, clSum;   // sums over modes; mean = sum / modes
+    vector<long long> modes;
+
+    void reset(int bins, double binWidth) {
+        width = binWidth;
+        ellSum.assign(bins, 0.0);
+        clSum.assign(bins, 0.0);
+        modes.assign(bins, 0);
     }
-    return phi;
+    double ell(int b) const { return modes[b] ? ellSum[b] / modes[b] : (b + 0.5) * width; }
+    double cl(int b) const { return modes[b] ? clSum[b] / modes[b] : 0.0; }
+};
+
+// Separable cosine (Tukey) taper: flat in the middle, cos² roll-off over the
+// outer `taper` fraction of the map on each side
+double apodization(int i, int n, double taper) {
+    double edge = taper * n;
+    double d = min(i + 0.5, n - i - 0.5);
+    if (d >= edge) return 1.0;
+    double s = sin(0.5 * PI * d / edge);
+    return s * s;
 }
 
-// Compute deflection field α = ∇φ
-void computeDeflection(
-    const Grid& phi,
-    Grid& alphaX,
-    Grid& alphaY
+// Flat-sky estimate of C_ℓ: apodize, FFT, and average |T_k|² Δ² / (N² <W²>)
+// over annuli of width binWidth up to the Nyquist ℓ. Spectrum rows are
+// split across threads, each accumulating private bins that are merged once.
+void estimatePowerSpectrum(
+    const Map2D& map,
+    double fieldRad,
+    double binWidth,
+    BandPowers& bands,
+    Workspace& ws,
+    double taper = 0.125
 ) {
-    for (int i = 1; i < N - 1; i++) {
-        for (int j = 1; j < N - 1; j++) {
-            alphaX[i][j] = (phi[i + 1][j] - phi[i - 1][j]) / 2.0;
-            alphaY[i][j] = (phi[i][j + 1] - phi[i][j - 1]) / 2.0;
+    int n = map.n;
+    vector<double> w(n);
+    double w2 = 0.0;
+    for (int i = 0; i < n; i++) {
+        w[i] = apodization(i, n, taper);
+        w2 += w[i] * w[i];
+    }
+    w2 = (w2 / n) * (w2 / n);   // mean of W² for the separable window
+
+    Map2D& windowed = ws.scratch;
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; i++) {
+            const double* in = map.row(i);
+            double* out = windowed.row(i);
+            for (int j = 0; j < n; j++) out[j] = in[j] * w[i] * w[j];
         }
+    });
+
+    Spectrum& modes = ws.specA;
+    forwardFFT2D(ws.plan, windowed, modes);
+
+    double pixel = fieldRad / n;
+    double scale = pixel * pixel / (double(n) * n * w2);
+    int bins = int(PI / pixel / binWidth) + 1;
+    bands.reset(bins, binWidth);
+    mutex merge;
+
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        BandPowers local;
+        local.reset(bins, binWidth);
+        for (int i = rowBegin; i < rowEnd; i++) {
+            double kx = waveNumber(i, n);
+            for (int j = 0; j < modes.nh; j++) {
+                double ky = waveNumber(j, n);
+                double ell = sqrt(kx * kx + ky * ky) / pixel;
+                int b = int(ell / binWidth);
+                if (ell == 0.0 || b >= bins) continue;
+                // Interior half-plane columns stand for themselves and their conjugates
+                int weight = (j == 0 || j == n / 2) ? 1 : 2;
+                local.ellSum[b] += weight * ell;
+                local.clSum[b] += weight * norm(modes.at(i, j)) * scale;
+                local.modes[b] += weight;
+            }
+        }
+        lock_guard<mutex> lock(merge);
+        for (int b = 0; b < bins; b++) {
+            bands.ellSum[b] += local.ellSum[b];
+            bands.clSum[b] += local.clSum[b];
+            bands.modes[b] += local.modes[b];
+        }
+    });
+}
+
+// Write binned C_ℓ and D_ℓ next to the input theory D_ℓ
+bool writePowerSpectrum(const string& path, const BandPowers& bands, const ClTable& theory) {
+    ofstream out(path);
+    if (!out) return false;
+    out << "# ell  C_ell[uK^2]  D_ell[uK^2]  D_ell_theory[uK^2]  modes\n";
+    out << scientific << setprecision(6);
+    for (size_t b = 0; b < bands.modes.size(); b++) {
+        if (!bands.modes[b]) continue;
+        double l = bands.ell(b);
+        double toD = l * (l + 1.0) / (2.0 * PI);
+        out << l << " " << bands.cl(b) << " " << bands.cl(b) * toD << " "
+            << theory(l) * toD << " " << bands.modes[b] << "\n";
+    }
+    return bool(out);
+}
+
+// Binary map file: a 64-byte header followed by N*N row-major float32 or
+// float64 values without row padding. Files are written with a few large
+// sequential writes and read back through mmap.
+const char MAP_MAGIC[8] = {'C', 'M', 'B', 'M', 'A', 'P', '0', '1'};
+
+struct MapFileHeader {
+    char magic[8];
+    uint32_t n;
+    uint32_t bytesPerValue;    // 4 = float32, 8 = float64
+    double fieldRad;
+    uint64_t payloadOffset;    // sizeof(MapFileHeader), keeps the payload 64-byte aligned
+    char reserved[32];
+};
+static_assert(sizeof(MapFileHeader) == 64, "map header must stay 64 bytes");
+
+// Write all of [data, data + bytes) to fd, retrying short writes
+bool writeAll(int fd, const char* data, size_t bytes) {
+    while (bytes > 0) {
+        ssize_t done = ::write(fd, data, bytes);
+        if (done < 0) return false;
+        data += done;
+        bytes -= size_t(done);
+    }
+    return true;
+}
+
+// Save a map as float32 (bytesPerValue = 4) or float64 (8). Rows are packed
+// (and converted in parallel) into a 64 MB staging block, and each full block
+// is written in one call.
+bool writeMapFile(const string& path, const Map2D& map, double fieldRad, int bytesPerValue) {
+    int n = map.n;
+    MapFileHeader h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.magic, MAP_MAGIC, sizeof h.magic);
+    h.n = uint32_t(n);
+    h.bytesPerValue = uint32_t(bytesPerValue);
+    h.fieldRad = fieldRad;
+    h.payloadOffset = sizeof h;
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return false;
+    bool ok = writeAll(fd, reinterpret_cast<const char*>(&h), sizeof h);
+
+    size_t rowBytes = size_t(n) * bytesPerValue;
+    int rowsPerBlock = int(max<size_t>(1, (size_t(64) << 20) / rowBytes));
+    vector<char> block(size_t(min(rowsPerBlock, n)) * rowBytes);
+    for (int first = 0; ok && first < n; first += rowsPerBlock) {
+        int rows = min(rowsPerBlock, n - first);
+        parallelRows(rows, [&](int rowBegin, int rowEnd) {
+            for (int r = rowBegin; r < rowEnd; r++) {
+                const double* in = map.row(first + r);
+                char* out = block.data() + size_t(r) * rowBytes;
+                if (bytesPerValue == 8) {
+                    memcpy(out, in, rowBytes);
+                } else {
+                    float* f = reinterpret_cast<float*>(out);
+                    for (int j = 0; j < n; j++) f[j] = float(in[j]);
+                }
+            }
+        });
+        ok = writeAll(fd, block.data(), size_t(rows) * rowBytes);
     }
+    return close(fd) == 0 && ok;
 }
 
-// Apply lensing remapping
-Grid lensCMB(
-    const Grid& cmb,
-    const Grid& alphaX,
-    const Grid& alphaY
+// Load a map file. float64 payloads are used in place: the file is mapped
+// copy-on-write and the map adopts it, so loading costs no read and no copy,
+// and any later in-place stage only touches its private pages. float32
+// payloads are widened into a freshly allocated map, rows in parallel.
+bool readMapFile(const string& path, Map2D& map, double& fieldRad) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(MapFileHeader)) {
+        close(fd);
+        return false;
+    }
+    size_t bytes = size_t(st.st_size);
+    void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return false;
+
+    MapFileHeader h;
+    memcpy(&h, base, sizeof h);
+    int n = int(h.n);
+    bool valid = memcmp(h.magic, MAP_MAGIC, sizeof h.magic) == 0 && h.payloadOffset == sizeof h
+                 && (h.bytesPerValue == 4 || h.bytesPerValue == 8)
+                 && n >= 8 && n <= MAX_N && (n & (n - 1)) == 0
+                 && bytes == sizeof h + size_t(n) * n * h.bytesPerValue;
+    if (!valid) {
+        munmap(base, bytes);
+        return false;
+    }
+    fieldRad = h.fieldRad;
+    char* payload = static_cast<char*>(base) + h.payloadOffset;
+
+    if (h.bytesPerValue == 8) {
+        // n is a power of two >= 8, so packed rows already have Map2D's stride
+        madvise(base, bytes, MADV_SEQUENTIAL);
+        map.adopt(n, size_t(n), reinterpret_cast<double*>(payload),
+                  [base, bytes](double*) { munmap(base, bytes); });
+        return true;
+    }
+
+    map.resize(n);
+    const float* values = reinterpret_cast<const float*>(payload);
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; i++) {
+            double* out = map.row(i);
+            const float* in = values + size_t(i) * n;
+            for (int j = 0; j < n; j++) out[j] = in[j];
+        }
+    });
+    munmap(base, bytes);
+    return true;
+}
+
+// Evaluate value(kx, ky, current) for every half-plane mode, rows split across threads
+template <class F>
+void mapModes(Spectrum& spec, F value) {
+    int n = spec.n;
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; i++) {
+            double kx = waveNumber(i, n);
+            for (int j = 0; j < spec.nh; j++) {
+                double ky = waveNumber(j, n);
+                spec.at(i, j) = value(kx, ky, spec.at(i, j));
+            }
+        }
+    });
+}
+
+// Hu-Okamoto TT quadratic estimator of the lensing potential, in the pixel
+// units of computeLensingFields (T_lensed(x) = T(x + ∇φ)). With Ct = C + N
+// (N a white-noise floor of noiseUkArcmin) and C, k in per-pixel DFT units:
+//   W = IDFT[T / Ct],  ∇G = IDFT[i k C T / Ct],  q(L) = -i L · DFT[W ∇G]
+//   A⁻¹(L) = L_i L_j DFT[ IDFT[k_i k_j C² / Ct] IDFT[1 / Ct] - g_i g_j ],
+//            g_i = IDFT[i k_i C / Ct]
+// and φ̂(L) = q(L) / A⁻¹(L). The filters keep ℓ < lmax and |k| < π (inside
+// the Nyquist circle), so odd factors never touch the Nyquist row/column and
+// the damping tail, where the map is dominated by lensed and interpolation
+// power rather than C, gets no weight. Every
+// convolution is a real-space product of inverse FFTs, and every pointwise
+// loop runs on all threads.
+void reconstructLensingPotential(
+    const Map2D& lensed,
+    const ClTable& cl,
+    double fieldRad,
+    Map2D& phiHat,
+    Workspace& ws,
+    double lmax = 3000.0,
+    double noiseUkArcmin = 1.0
 ) {
-    Grid lensed(N, vector<double>(N, 0.0));
+    int n = lensed.n;
+    double pixel = fieldRad / n;
+    double arcmin = PI / (180.0 * 60.0);
+    double noisePix = pow(noiseUkArcmin * arcmin / pixel, 2);
+    auto clPix = [&](double kx, double ky) {
+        return cl(sqrt(kx * kx + ky * ky) / pixel) / (pixel * pixel);
+    };
+    auto invCt = [&](double kx, double ky) {
+        double k2 = kx * kx + ky * ky;
+        if (k2 >= PI * PI || k2 >= pow(lmax * pixel, 2)) return 0.0;
+        double c = clPix(kx, ky);
+        return c > 0 ? 1.0 / (c + noisePix) : 0.0;
+    };
+    // C / C_total: the Wiener-like weight of each kept mode
+    auto ratio = [&](double kx, double ky) { return clPix(kx, ky) * invCt(kx, ky); };
 
-    for (int i = 1; i < N - 1; i++) {
-        for (int j = 1; j < N - 1; j++) {
-            int newX = int(i + alphaX[i][j]);
-            int newY = int(j + alphaY[i][j]);
+    Map2D w(n), gx(n), gy(n);
+    Map2D& pij = ws.scratch;
+    Spectrum& tK = ws.specA;
+    Spectrum& work = ws.specB;
+    auto multiplyInto = [&](Map2D& a, const Map2D& b) {
+        parallelRows(n, [&](int rowBegin, int rowEnd) {
+            for (int i = rowBegin; i < rowEnd; i++) {
+                double* ra = a.row(i);
+                const double* rb = b.row(i);
+                for (int j = 0; j < n; j++) ra[j] *= rb[j];
+            }
+        });
+    };
 
-            if (newX >= 0 && newX < N && newY >= 0 && newY < N)
-                lensed[i][j] = cmb[newX][newY];
-            else
-                lensed[i][j] = cmb[i][j];
+    // Filtered fields from the data
+    forwardFFT2D(ws.plan, lensed, tK);
+    work.data = tK.data;
+    mapModes(work, [&](double kx, double ky, cplx t) { return t * invCt(kx, ky); });
+    inverseFFT2D(ws.plan, work, w);
+    work.data = tK.data;
+    mapModes(work, [&](double kx, double ky, cplx t) { return cplx(0.0, kx) * ratio(kx, ky) * t; });
+    inverseFFT2D(ws.plan, work, gx);
+    work.data = tK.data;
+    mapModes(work, [&](double kx, double ky, cplx t) { return cplx(0.0, ky) * ratio(kx, ky) * t; });
+    inverseFFT2D(ws.plan, work, gy);
+    multiplyInto(gx, w);
+    multiplyInto(gy, w);
+
+    // q(L) = -i (Lx DFT[W Gx] + Ly DFT[W Gy]), kept in tK
+    forwardFFT2D(ws.plan, gx, work);
+    forwardFFT2D(ws.plan, gy, tK);
+    parallelRows(n, [&](int rowBegin, int rowEnd) {
+        for (int i = rowBegin; i < rowEnd; i++) {
+            double lx = (i == n / 2) ? 0.0 : waveNumber(i, n);
+            for (int j = 0; j < tK.nh; j++) {
+                double ly = (j == n / 2) ? 0.0 : waveNumber(j, n);
+                tK.at(i, j) = cplx(0.0, -1.0) * (lx * work.at(i, j) + ly * tK.at(i, j));
+            }
+        }
+    });
+
+    // Normalization from the filters alone: w = IDFT[1/Ct], g_i = IDFT[i k_i C/Ct]
+    mapModes(work, [&](double kx, double ky, cplx) { return cplx(invCt(kx, ky), 0.0); });
+    inverseFFT2D(ws.plan, work, w);
+    mapModes(work, [&](double kx, double ky, cplx) { return cplx(0.0, kx * ratio(kx, ky)); });
+    inverseFFT2D(ws.plan, work, gx);
+    mapModes(work, [&](double kx, double ky, cplx) { return cplx(0.0, ky * ratio(kx, ky)); });
+    inverseFFT2D(ws.plan, work, gy);
+
+    vector<double> aInv(size_t(n) * tK.nh, 0.0);
+    for (int term = 0; term < 3; term++) {   // xx, xy, yy
+        mapModes(work, [&](double kx, double ky, cplx) {
+            double ki = (term == 2) ? ky : kx;
+            double kj = (term == 0) ? kx : ky;
+            return cplx(ki * kj * clPix(kx, ky) * ratio(kx, ky), 0.0);
+        });
+        inverseFFT2D(ws.plan, work, pij);
+        const Map2D& gi = (term == 2) ? gy : gx;
+        const Map2D& gj = (term == 0) ? gx : gy;
+        parallelRows(n, [&](int rowBegin, int rowEnd) {
+            for (int i = rowBegin; i < rowEnd; i++) {
+                double* p = pij.row(i);
+                const double* rw = w.row(i);
+                const double* ri = gi.row(i);
+                const double* rj = gj.row(i);
+                for (int j = 0; j < n; j++) p[j] = p[j] * rw[j] - ri[j] * rj[j];
+            }
+        });
+        forwardFFT2D(ws.plan, pij, work);
+        double multiplicity = (term == 1) ? 2.0 : 1.0;
+        parallelRows(n, [&](int rowBegin, int rowEnd) {
+            for (int i = rowBegin; i < rowEnd; i++) {
+                double lx = (i == n / 2) ? 0.0 : waveNumber(i, n);
+                for (int j = 0; j < work.nh; j++) {
+                    double ly = (j == n / 2) ? 0.0 : waveNumber(j, n);
+                    double li = (term == 2) ? ly : lx;
+                    double lj = (term == 0) ? lx : ly;
+                    aInv[size_t(i) * work.nh + j] += multiplicity * li * lj * work.at(i, j).real();
+                }
+            }
+        });
+    }
+
+    for (int i = 0; i < n; i++)
+        for (int j = 0; j < tK.nh; j++) {
+            double a = aInv[size_t(i) * tK.nh + j];
+            double lx = waveNumber(i, n), ly = waveNumber(j, n);
+            // Filters reach ℓ < lmax, so there is no response beyond L = 2 lmax
+            bool outside = (i == n / 2 || j == n / 2) || lx * lx + ly * ly >= pow(2.0 * lmax * pixel, 2);
+            tK.at(i, j) = (a > 0 && !outside) ? tK.at(i, j) / a : 0.0;
+        }
+    inverseFFT2D(ws.plan, tK, phiHat);
+}
+
+// Cross-correlation of the reconstruction with the input potential in L bins:
+// amplitude C^{φ̂φ}/C^{φφ} (1 for an unbiased estimator) and coefficient r
+void reportReconstruction(
+    const Map2D& phiHat,
+    const Map2D& phi,
+    double fieldRad,
+    double Lmax,
+    Workspace& ws,
+    int bins = 12
+) {
+    int n = phi.n;
+    forwardFFT2D(ws.plan, phiHat, ws.specA);
+    forwardFFT2D(ws.plan, phi, ws.specB);
+    double pixel = fieldRad / n;
+    double kMax = min(PI, Lmax * pixel);
+    vector<double> cross(bins, 0.0), autoHat(bins, 0.0), autoIn(bins, 0.0);
+    for (int i = 0; i < n; i++) {
+        double kx = waveNumber(i, n);
+        for (int j = 0; j < ws.specA.nh; j++) {
+            double ky = waveNumber(j, n);
+            double k = sqrt(kx * kx + ky * ky);
+            int b = int(k / kMax * bins);
+            if (k == 0.0 || b >= bins) continue;
+            cplx a = ws.specA.at(i, j), c = ws.specB.at(i, j);
+            cross[b] += (a * conj(c)).real();
+            autoHat[b] += norm(a);
+            autoIn[b] += norm(c);
+        }
+    }
+    cout << "\n--- Lensing Reconstruction vs Input Potential ---\n";
+    cout << setw(10) << "L" << setw(12) << "amplitude" << setw(12) << "r" << "\n";
+    for (int b = 0; b < bins; b++) {
+        if (autoIn[b] <= 0 || autoHat[b] <= 0) continue;
+        double L = (b + 0.5) * kMax / bins / pixel;
+        cout << setw(10) << fixed << setprecision(0) << L
+             << setw(12) << setprecision(3) << cross[b] / autoIn[b]
+             << setw(12) << cross[b] / sqrt(autoHat[b] * autoIn[b]) << "\n";
+    }
+}
+
+// Streaming mean and covariance of band-power vectors (Welford), so batch runs
+// never keep per-realization spectra. Partial results merge with Chan's formula.
+struct SpectrumStats {
+    long long count = 0;
+    vector<double> mean, m2;   // m2 is d x d, row-major
+
+    explicit SpectrumStats(int d = 0) : mean(d, 0.0), m2(size_t(d) * d, 0.0) {}
+
+    void add(const vector<double>& x) {
+        size_t d = mean.size();
+        count++;
+        vector<double> before(d);
+        for (size_t a = 0; a < d; a++) {
+            before[a] = x[a] - mean[a];
+            mean[a] += before[a] / count;
+        }
+        for (size_t a = 0; a < d; a++)
+            for (size_t b = 0; b < d; b++)
+                m2[a * d + b] += before[a] * (x[b] - mean[b]);
+    }
+
+    void merge(const SpectrumStats& o) {
+        if (o.count == 0) return;
+        size_t d = mean.size();
+        double na = double(count), nb = double(o.count), nt = na + nb;
+        vector<double> delta(d);
+        for (size_t a = 0; a < d; a++) delta[a] = o.mean[a] - mean[a];
+        for (size_t a = 0; a < d; a++) {
+            mean[a] += delta[a] * nb / nt;
+            for (size_t b = 0; b < d; b++)
+                m2[a * d + b] += o.m2[a * d + b] + delta[a] * delta[b] * na * nb / nt;
+        }
+        count += o.count;
+    }
+
+    double covariance(size_t a, size_t b) const {
+        return count > 1 ? m2[a * mean.size() + b] / (count - 1) : 0.0;
+    }
+};
+
+struct BatchSettings {
+    int realizations = 100;
+    int n = 256;
+    double fieldDeg = 10.0;
+    uint64_t seed = 1;
+    Interp method = Interp::Bicubic;
+    int planes = 0;            // 0 = fixed single Gaussian blob
+    string clPath = "-";
+    string prefix = "batch";
+};
+
+// Write the band-power mean, standard deviation and full covariance matrix
+bool writeBatchResults(
+    const BatchSettings& set,
+    const BandPowers& bins,
+    const ClTable& theory,
+    const SpectrumStats& primary,
+    const SpectrumStats& lensed
+) {
+    ofstream out(set.prefix + "_cl_mean.txt");
+    if (!out) return false;
+    out << "# " << primary.count << " realizations, N = " << set.n << ", field = "
+        << set.fieldDeg << " deg\n";
+    out << "# ell  C_primary  sigma_primary  C_lensed  sigma_lensed  C_theory  [uK^2]\n";
+    out << scientific << setprecision(6);
+    for (size_t b = 0; b < bins.modes.size(); b++) {
+        if (!bins.modes[b]) continue;
+        out << bins.ell(b) << " " << primary.mean[b] << " " << sqrt(primary.covariance(b, b))
+            << " " << lensed.mean[b] << " " << sqrt(lensed.covariance(b, b)) << " "
+            << theory(bins.ell(b)) << "\n";
+    }
+
+    const SpectrumStats* stats[2] = {&primary, &lensed};
+    const char* names[2] = {"_cov_primary.txt", "_cov_lensed.txt"};
+    for (int m = 0; m < 2; m++) {
+        ofstream cov(set.prefix + names[m]);
+        if (!cov) return false;
+        cov << "# covariance of C_l bins (rows/columns follow the bins of "
+            << set.prefix << "_cl_mean.txt, empty bins skipped)\n";
+        cov << scientific << setprecision(6);
+        for (size_t a = 0; a < bins.modes.size(); a++) {
+            if (!bins.modes[a]) continue;
+            for (size_t b = 0; b < bins.modes.size(); b++)
+                if (bins.modes[b]) cov << stats[m]->covariance(a, b) << " ";
+            cov << "\n";
+        }
+    }
+    return bool(out);
+}
+
+// Non-interactive run of many realizations. The lensing fields depend only on
+// the fixed mass distribution and are computed once and shared read-only.
+// One worker per hardware thread pulls realization indices from an atomic
+// counter and reuses its own maps, FFT plan and spectra; band powers go
+// straight into per-worker running statistics, merged at the end.
+int runBatch(const BatchSettings& set) {
+    int n = set.n;
+    double fieldRad = set.fieldDeg * PI / 180.0;
+    ClTable cl;
+    if (set.clPath == "-" || !loadClTable(set.clPath, cl)) {
+        if (set.clPath != "-") cerr << "Could not read " << set.clPath << ", using built-in spectrum.\n";
+        cl = defaultClTable();
+    }
+
+    // The single blob is fixed and shared read-only; random planes are traced
+    // per realization by each worker into its own maps
+    Map2D rho, phi, alphaX, alphaY;
+    ClTable kappaCl = defaultConvergenceTable();
+    if (set.planes == 0) {
+        rho.resize(n);
+        phi.resize(n);
+        alphaX.resize(n);
+        alphaY.resize(n);
+        Workspace ws(n);
+        generateMassDistribution(rho);
+        computeLensingFields(rho, phi, alphaX, alphaY, ws);
+    }
+
+    double binWidth = 2.0 * (2.0 * PI / fieldRad);
+    int bins = int(PI * n / fieldRad / binWidth) + 1;
+    int workers = max(1, min(set.realizations, int(thread::hardware_concurrency())));
+
+    vector<SpectrumStats> primary(workers, SpectrumStats(bins)), lensed(workers, SpectrumStats(bins));
+    BandPowers binLayout;
+    atomic<int> next(0), done(0);
+    mutex report;
+
+    auto worker = [&](int id) {
+        rowThreads = 1;
+        Workspace ws(n);
+        Map2D cmb(n), lensedCMB(n), ownPhi, ownX, ownY;
+        if (set.planes > 0) {
+            ownPhi.resize(n);
+            ownX.resize(n);
+            ownY.resize(n);
+        }
+        BandPowers bands;
+        int r;
+        while ((r = next++) < set.realizations) {
+            generatePrimaryCMB(cmb, cl, fieldRad, set.seed + r, ws);
+            if (set.planes > 0) {
+                traceMultiPlane(set.planes, kappaCl, fieldRad, set.seed + r, ownPhi, ownX, ownY, ws);
+                lensCMB(cmb, ownX, ownY, lensedCMB, set.method);
+            } else {
+                lensCMB(cmb, alphaX, alphaY, lensedCMB, set.method);
+            }
+            estimatePowerSpectrum(cmb, fieldRad, binWidth, bands, ws);
+            vector<double> x(bins);
+            for (int b = 0; b < bins; b++) x[b] = bands.cl(b);
+            primary[id].add(x);
+            estimatePowerSpectrum(lensedCMB, fieldRad, binWidth, bands, ws);
+            for (int b = 0; b < bins; b++) x[b] = bands.cl(b);
+            lensed[id].add(x);
+
+            lock_guard<mutex> lock(report);
+            if (r == 0) binLayout = bands;   // mode counts and mean l per bin
+            int finished = ++done;
+            if (finished % max(1, set.realizations / 10) == 0 || finished == set.realizations)
+                cout << "  " << finished << " / " << set.realizations << " realizations\n";
         }
+    };
+
+    cout << "Batch: " << set.realizations << " realizations of " << n << "^2 on "
+         << workers << " thread(s)\n";
+    vector<thread> pool;
+    for (int id = 0; id < workers; id++) pool.emplace_back(worker, id);
+    for (thread& t : pool) t.join();
+
+    for (int id = 1; id < workers; id++) {
+        primary[0].merge(primary[id]);
+        lensed[0].merge(lensed[id]);
     }
-    return lensed;
+    if (!writeBatchResults(set, binLayout, cl, primary[0], lensed[0])) {
+        cerr << "Could not write batch results with prefix " << set.prefix << "\n";
+        return 1;
+    }
+    cout << "Results written to " << set.prefix << "_cl_mean.txt, " << set.prefix
+         << "_cov_primary.txt and " << set.prefix << "_cov_lensed.txt\n";
+    return 0;
 }
 
 // Display a small patch
-void displaySample(const Grid& map, const string& title) {
+void displaySample(const Map2D& map, const string& title) {
+    int n = map.n;
     cout << "\n--- " << title << " (Central Patch) ---\n";
-    for (int i = N / 2 - 3; i <= N / 2 + 3; i++) {
-        for (int j = N / 2 - 3; j <= N / 2 + 3; j++) {
-            cout << setw(8) << fixed << setprecision(3) << map[i][j] << " ";
+    for (int i = n / 2 - 3; i <= n / 2 + 3; i++) {
+        for (int j = n / 2 - 3; j <= n / 2 + 3; j++) {
+            cout << setw(8) << fixed << setprecision(3) << map(i, j) << " ";
         }
         cout << endl;
     }
 }
 
+// Ask for a power-of-two resolution between 8 and MAX_N
+int readResolution() {
+    int n;
+    while (true) {
+        cout << "\nMap resolution N (power of two, 8-" << MAX_N << "): ";
+        if (cin >> n && n >= 8 && n <= MAX_N && (n & (n - 1)) == 0)
+            return n;
+        if (!cin) {
+            if (cin.eof()) exit(1);
+            cin.clear();
+            cin.ignore(10000, '\n');
+        }
+        cout << "Invalid resolution.\n";
+    }
+}
+
+// Parse "--batch R [--n N] [--field DEG] [--seed S] [--cl FILE] [--interp 1|2]
+//        [--planes P] [--out PREFIX]"
+bool parseBatchArgs(int argc, char* argv[], BatchSettings& set) {
+    for (int a = 1; a < argc; a++) {
+        string key = argv[a];
+        if (a + 1 >= argc) return false;
+        string val = argv[++a];
+        if (key == "--batch") set.realizations = stoi(val);
+        else if (key == "--n") set.n = stoi(val);
+        else if (key == "--field") set.fieldDeg = stod(val);
+        else if (key == "--seed") set.seed = stoull(val);
+        else if (key == "--cl") set.clPath = val;
+        else if (key == "--interp") set.method = (val == "1") ? Interp::Bilinear : Interp::Bicubic;
+        else if (key == "--planes") set.planes = stoi(val);
+        else if (key == "--out") set.prefix = val;
+        else return false;
+    }
+    return set.realizations > 0 && set.planes >= 0 && set.n >= 8 && set.n <= MAX_N &&
+           (set.n & (set.n - 1)) == 0 && set.fieldDeg > 0;
+}
+
+// Band powers of a saved map file: "--spectrum FILE [PREFIX]"
+int runSpectrumOfFile(const string& path, const string& prefix) {
+    Map2D map;
+    double fieldRad;
+    auto start = chrono::steady_clock::now();
+    if (!readMapFile(path, map, fieldRad)) {
+        cerr << "Could not read map file " << path << "\n";
+        return 1;
+    }
+    double loadMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    cout << "Loaded " << map.n << "^2 map (" << fieldRad * 180.0 / PI << " deg) in "
+         << fixed << setprecision(1) << loadMs << " ms\n";
+
+    Workspace ws(map.n);
+    BandPowers bands;
+    estimatePowerSpectrum(map, fieldRad, 2.0 * (2.0 * PI / fieldRad), bands, ws);
+    string out = prefix + "_cl.txt";
+    if (!writePowerSpectrum(out, bands, defaultClTable())) {
+        cerr << "Could not write " << out << "\n";
+        return 1;
+    }
+    cout << "Power spectrum written to " << out << "\n";
+    return 0;
+}
+
 // Main CLI Loop
-int main() {
+int main(int argc, char* argv[]) {
+    if (argc > 1 && string(argv[1]) == "--spectrum") {
+        if (argc < 3) {
+            cerr << "Usage: " << argv[0] << " --spectrum FILE [PREFIX]\n";
+            return 1;
+        }
+        return runSpectrumOfFile(argv[2], argc > 3 ? argv[3] : "map");
+    }
+    if (argc > 1) {
+        BatchSettings set;
+        bool ok = false;
+        try {
+            ok = string(argv[1]) == "--batch" && parseBatchArgs(argc, argv, set);
+        } catch (const exception&) {
+            ok = false;
+        }
+        if (!ok) {
+            cerr << "Usage: " << argv[0] << " --batch R [--n N] [--field DEG] [--seed S]"
+                 << " [--cl FILE] [--interp 1|2] [--planes P] [--out PREFIX]\n"
+                 << "       " << argv[0] << " --spectrum FILE [PREFIX]\n";
+            return 1;
+        }
+        return runBatch(set);
+    }
+
     cout << "\n============================================\n";
     cout << " CMB Gravitational Lensing CLI Simulator\n";
     cout << " Research-Level Computational Physics Tool\n";
     cout << "============================================\n";
 
-    char choice;
-    do {
-        Grid cmb = generatePrimaryCMB();
-        Grid rho = generateMassDistribution();
-        Grid phi = computeLensingPotential(rho);
+    int n = readResolution();
+
+    int interpChoice;
+    cout << "Interpolation (1 = bilinear, 2 = bicubic): ";
+    cin >> interpChoice;
+    Interp method = (interpChoice == 1) ? Interp::Bilinear : Interp::Bicubic;
+
+    double fieldDeg;
+    cout << "Field width (degrees): ";
+    cin >> fieldDeg;
+    if (!(fieldDeg > 0)) fieldDeg = 10.0;
+    double fieldRad = fieldDeg * PI / 180.0;
+
+    string clPath;
+    cout << "C_l table file (ell D_ell in uK^2 per line, '-' for built-in): ";
+    cin >> clPath;
+    ClTable cl;
+    if (clPath == "-" || !loadClTable(clPath, cl)) {
+        if (clPath != "-") cout << "Could not read " << clPath << ", using built-in spectrum.\n";
+        cl = defaultClTable();
+    }
 
-        Grid alphaX(N, vector<double>(N, 0.0));
-        Grid alphaY(N, vector<double>(N, 0.0));
-        computeDeflection(phi, alphaX, alphaY);
+    uint64_t seed;
+    cout << "Random seed: ";
+    cin >> seed;
 
-        Grid lensedCMB = lensCMB(cmb, alphaX, alphaY);
+    int planes;
+    cout << "Lens planes (0 = single Gaussian blob): ";
+    cin >> planes;
+    planes = max(planes, 0);
+    ClTable kappaCl = defaultConvergenceTable();
+
+    int saveBytes;
+    cout << "Save maps (0 = no, 4 = float32, 8 = float64): ";
+    cin >> saveBytes;
+
+    // All maps are allocated once and refilled in place on every realization
+    Map2D cmb(n), rho(n), phi(n), alphaX(n), alphaY(n), lensedCMB(n), phiHat(n);
+    Workspace ws(n);
+    double lmaxFilter = 3000.0;
+    BandPowers primaryBands, lensedBands;
+    double binWidth = 2.0 * (2.0 * PI / fieldRad);   // two fundamental modes
+
+    char choice;
+    uint64_t realization = 0;
+    do {
+        uint64_t realizationSeed = seed + realization++;
+        cout << "\nRealization seed: " << realizationSeed << "\n";
+        generatePrimaryCMB(cmb, cl, fieldRad, realizationSeed, ws);
+        if (planes > 0) {
+            traceMultiPlane(planes, kappaCl, fieldRad, realizationSeed, phi, alphaX, alphaY, ws);
+        } else {
+            generateMassDistribution(rho);
+            computeLensingFields(rho, phi, alphaX, alphaY, ws);
+        }
+        lensCMB(cmb, alphaX, alphaY, lensedCMB, method);
 
         displaySample(cmb, "Primary CMB");
         displaySample(lensedCMB, "Lensed CMB");
 
+        estimatePowerSpectrum(cmb, fieldRad, binWidth, primaryBands, ws);
+        estimatePowerSpectrum(lensedCMB, fieldRad, binWidth, lensedBands, ws);
+        string tag = "_seed" + to_string(realizationSeed) + ".txt";
+        if (writePowerSpectrum("cl_primary" + tag, primaryBands, cl) &&
+            writePowerSpectrum("cl_lensed" + tag, lensedBands, cl))
+            cout << "\nPower spectra written to cl_primary" << tag << " and cl_lensed" << tag << "\n";
+        else
+            cout << "\nCould not write power spectrum files.\n";
+
+        if (saveBytes == 4 || saveBytes == 8) {
+            string mapTag = "_seed" + to_string(realizationSeed) + ".map";
+            if (writeMapFile("cmb_primary" + mapTag, cmb, fieldRad, saveBytes) &&
+                writeMapFile("cmb_lensed" + mapTag, lensedCMB, fieldRad, saveBytes) &&
+                writeMapFile("phi" + mapTag, phi, fieldRad, saveBytes))
+                cout << "Maps written to cmb_primary" << mapTag << ", cmb_lensed" << mapTag
+                     << " and phi" << mapTag << "\n";
+            else
+                cout << "Could not write map files.\n";
+        }
+
+        reconstructLensingPotential(lensedCMB, cl, fieldRad, phiHat, ws, lmaxFilter);
+        reportReconstruction(phiHat, phi, fieldRad, 2.0 * lmaxFilter, ws);
+
         cout << "\nRe-run simulation with new realization? (y/n): ";
         cin >> choice;
 